@@ -3,17 +3,82 @@
 #include <utility>
 #include <stdexcept>
 #include <queue>
+#include <vector>
 #include <cassert>
 #include <functional>
 #include <sstream>
+#include <type_traits>
 
 namespace vk_data {
+
+// A digest is a summary that every node keeps of its own subtree, refreshed
+// whenever the subtree's entries or shape change. AVLTree::diff() uses it to
+// skip subtrees that are identical on both sides.
+
+// The default: no digest is kept, and no two subtrees are ever assumed equal.
+struct NoDigest {
+    template <class N>
+    void refresh(const N&) {}
+
+    bool sameDigest(const NoDigest&) const {
+        return false;
+    }
+};
+
+// A Merkle-style hash of each subtree, built from std::hash of the node's
+// key and data and the digests of its children. Two subtrees with the same
+// shape and contents have the same digest, so diffing two trees that were
+// built by the same sequence of updates only walks the parts that differ.
+// Like any hash it can collide, in which case diff() may miss the
+// differences in that subtree.
+//
+// The digest only sees updates made through the tree. Data changed in place
+// through a reference returned by get() or an iterator is not reflected
+// until that key is add()ed again.
+struct MerkleDigest {
+    std::size_t _digest;
+
+    explicit MerkleDigest() :
+        _digest(0) {}
+
+    template <class N>
+    void refresh(const N& node) {
+        typedef typename std::decay<decltype(node._key)>::type Key;
+        typedef typename std::decay<decltype(node._data)>::type Data;
+
+        std::size_t h = _mix(std::hash<Key>()(node._key));
+        h = _combine(h, std::hash<Data>()(node._data));
+        h = _combine(h, node._left ? node._left->_digest : 0);
+        h = _combine(h, node._right ? node._right->_digest : 0);
+        _digest = h;
+    }
+
+    bool sameDigest(const MerkleDigest& other) const {
+        return _digest == other._digest;
+    }
+
+private:
+    // std::hash is often the identity on integers, so every input is run
+    // through the splitmix64 finalizer before it is folded in.
+    static std::size_t _mix(std::size_t x) {
+        unsigned long long z = x + 0x9e3779b97f4a7c15ULL;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return static_cast<std::size_t>(z ^ (z >> 31));
+    }
+
+    static std::size_t _combine(std::size_t seed, std::size_t value) {
+        // Scaling the seed first keeps the combination order-dependent.
+        return _mix((seed * 0x100000001b3ULL) ^ _mix(value));
+    }
+};
+
 namespace {
-template <class K, class T>
-class AVLNode {
+template <class K, class T, class D>
+class AVLNode : public D {
 public:
-    AVLNode<K, T> *_left;
-    AVLNode<K, T> *_right;
+    AVLNode<K, T, D> *_left;
+    AVLNode<K, T, D> *_right;
     int _height;
     K _key;
     T _data;
@@ -46,44 +111,87 @@ public:
         _right(nullptr),
         _height(height),
         _key(std::move(key)),
-        _data(std::move(data)) {}
+        _data(std::move(data)) {
+        update();
+    }
+
+    // Refreshes the digest after this node's data or children changed. The
+    // children's digests must already be up to date.
+    void update() {
+        D::refresh(*this);
+    }
 };
-} // namespace
 
-template <class K, class T, class L = std::less<K>>
-class AVLTree {
-private:
-    L _less;
-    AVLNode<K, T>* _root;
-    int _size;
+// Rotations relink nodes and refresh their digests; the balancing policies
+// below decide how the heights (ranks) of the rotated nodes change.
+template <class N>
+N* rotateRight(N* hinge) {
+    auto toReturn = hinge->_left;
+    hinge->_left = toReturn->_right;
+    toReturn->_right = hinge;
+    hinge->update();
+    toReturn->update();
+    return toReturn;
+}
+
+template <class N>
+N* rotateLeft(N* hinge) {
+    auto toReturn = hinge->_right;
+    hinge->_right = toReturn->_left;
+    toReturn->_left = hinge;
+    hinge->update();
+    toReturn->update();
+    return toReturn;
+}
+
+template <class N>
+int rankOf(N* node) {
+    return node ? node->_height : -1;
+}
+} // namespace
 
-    bool less(const K& k1, const K& k2) const {
-        return _less(k1, k2);
+// A balancing policy tells the tree how to restore balance at a node after
+// one of its subtrees has changed. afterAdd() is called on every node on the
+// path back up from an insertion (or a join), and afterRemove() on every node
+// on the path back up from a removal. Both return the new root of the
+// node's subtree. The policy owns the node's _height field, which it may
+// treat as a rank rather than the exact height.
+
+// Strict AVL balancing: _height is the exact height, and every node's
+// children differ in height by at most one. Keeps the tree as shallow as
+// possible, but a removal can rotate at every node on its path.
+struct AVLBalance {
+    template <class N>
+    static N* afterAdd(N* node) {
+        node->setHeight();
+        return _fixRotations(node);
     }
 
-    bool equals(const K& k1, const K& k2) const {
-        return !_less(k1, k2) && !_less(k2, k1);
+    template <class N>
+    static N* afterRemove(N* node) {
+        node->setHeight();
+        return _fixRotations(node);
     }
 
-    AVLNode<K, T>* _rotateRight(AVLNode<K, T>* hinge) {
-        auto toReturn = hinge->_left;
-        hinge->_left = toReturn->_right;
+private:
+    template <class N>
+    static N* _rotateRight(N* hinge) {
+        auto toReturn = rotateRight(hinge);
         hinge->setHeight();
-        toReturn->_right = hinge;
         toReturn->setHeight();
         return toReturn;
     }
 
-    AVLNode<K, T>* _rotateLeft(AVLNode<K, T>* hinge) {
-        auto toReturn = hinge->_right;
-        hinge->_right = toReturn->_left;
+    template <class N>
+    static N* _rotateLeft(N* hinge) {
+        auto toReturn = rotateLeft(hinge);
         hinge->setHeight();
-        toReturn->_left = hinge;
         toReturn->setHeight();
         return toReturn;
     }
 
-    AVLNode<K, T>* _fixRotations(AVLNode<K, T>* hinge) {
+    template <class N>
+    static N* _fixRotations(N* hinge) {
         int bf = hinge->getBF();
         if (-1 <= bf && bf <= 1)
             return hinge;
@@ -109,30 +217,210 @@ private:
             }
         }
     }
+};
 
-    AVLNode<K, T>* _add(AVLNode<K, T>* start, AVLNode<K, T>* newNode) {
+// Weak AVL balancing (Haeupler, Sen and Tarjan). _height is a rank: a leaf
+// has rank 0, a missing child rank -1, and every child's rank is one or two
+// below its parent's. Without removals this is exactly an AVL tree. With
+// them, the height stays below 2 log n, and each update does O(1) amortized
+// rank changes and at most two rotations, since removals no longer cascade
+// rotations up the path.
+struct WAVLBalance {
+    template <class N>
+    static N* afterAdd(N* node) {
+        int left = node->_height - rankOf(node->_left);
+        int right = node->_height - rankOf(node->_right);
+        if (left && right)
+            return node;
+
+        // A child caught up with us. If the other child is a 1-child, we can
+        // simply promote and let our parent take a look.
+        if (left + right == 1) {
+            node->_height++;
+            return node;
+        }
+
+        if (!left) {
+            auto child = node->_left;
+            int outer = child->_height - rankOf(child->_left);
+            int inner = child->_height - rankOf(child->_right);
+            if (outer == 1 && inner == 1) {
+                // Only a join can produce a 1,1 child here. Rotating it up
+                // and promoting it keeps all rank differences valid.
+                auto top = rotateRight(node);
+                top->_height++;
+                return top;
+            }
+            if (outer == 1) {
+                auto top = rotateRight(node);
+                node->_height--;
+                return top;
+            }
+            node->_left = rotateLeft(child);
+            auto top = rotateRight(node);
+            top->_height++;
+            child->_height--;
+            node->_height--;
+            return top;
+        } else {
+            auto child = node->_right;
+            int outer = child->_height - rankOf(child->_right);
+            int inner = child->_height - rankOf(child->_left);
+            if (outer == 1 && inner == 1) {
+                auto top = rotateLeft(node);
+                top->_height++;
+                return top;
+            }
+            if (outer == 1) {
+                auto top = rotateLeft(node);
+                node->_height--;
+                return top;
+            }
+            node->_right = rotateRight(child);
+            auto top = rotateLeft(node);
+            top->_height++;
+            child->_height--;
+            node->_height--;
+            return top;
+        }
+    }
+
+    template <class N>
+    static N* afterRemove(N* node) {
+        // A leaf must have rank 0; it may have been left with rank 1 after
+        // losing its only child.
+        if (!node->_left && !node->_right) {
+            node->_height = 0;
+            return node;
+        }
+
+        int left = node->_height - rankOf(node->_left);
+        int right = node->_height - rankOf(node->_right);
+        if (left < 3 && right < 3)
+            return node;
+
+        if (left == 3) {
+            auto sibling = node->_right;
+            // Demoting ourselves fixes the 3-child, and may in turn make us
+            // a 3-child of our parent.
+            if (right == 2) {
+                node->_height--;
+                return node;
+            }
+
+            int outer = sibling->_height - rankOf(sibling->_right);
+            int inner = sibling->_height - rankOf(sibling->_left);
+            if (outer == 2 && inner == 2) {
+                node->_height--;
+                sibling->_height--;
+                return node;
+            }
+
+            // From here on we rotate, and the rebalancing stops.
+            if (outer == 1) {
+                auto top = rotateLeft(node);
+                top->_height++;
+                node->_height--;
+                if (!node->_left && !node->_right)
+                    node->_height--;
+                return top;
+            }
+            node->_right = rotateRight(sibling);
+            auto top = rotateLeft(node);
+            top->_height += 2;
+            sibling->_height--;
+            node->_height -= 2;
+            return top;
+        } else {
+            auto sibling = node->_left;
+            if (left == 2) {
+                node->_height--;
+                return node;
+            }
+
+            int outer = sibling->_height - rankOf(sibling->_left);
+            int inner = sibling->_height - rankOf(sibling->_right);
+            if (outer == 2 && inner == 2) {
+                node->_height--;
+                sibling->_height--;
+                return node;
+            }
+
+            if (outer == 1) {
+                auto top = rotateRight(node);
+                top->_height++;
+                node->_height--;
+                if (!node->_left && !node->_right)
+                    node->_height--;
+                return top;
+            }
+            node->_left = rotateLeft(sibling);
+            auto top = rotateRight(node);
+            top->_height += 2;
+            sibling->_height--;
+            node->_height -= 2;
+            return top;
+        }
+    }
+};
+
+template <class K, class T, class L = std::less<K>, class B = AVLBalance,
+            class D = NoDigest>
+class AVLTree {
+private:
+    L _less;
+    AVLNode<K, T, D>* _root;
+    int _size;
+
+    bool less(const K& k1, const K& k2) const {
+        return _less(k1, k2);
+    }
+
+    bool equals(const K& k1, const K& k2) const {
+        return !_less(k1, k2) && !_less(k2, k1);
+    }
+
+    // Every node whose subtree changed goes through one of these two on the
+    // way back up, so its digest is refreshed before the policy rebalances.
+    AVLNode<K, T, D>* _afterAdd(AVLNode<K, T, D>* node) {
+        node->update();
+        return B::afterAdd(node);
+    }
+
+    AVLNode<K, T, D>* _afterRemove(AVLNode<K, T, D>* node) {
+        node->update();
+        return B::afterRemove(node);
+    }
+
+    // Sets *placed to the node that ends up holding the new entry: newNode
+    // itself, or the existing node whose data it replaced.
+    AVLNode<K, T, D>* _add(AVLNode<K, T, D>* start, AVLNode<K, T, D>* newNode,
+                                                AVLNode<K, T, D>** placed) {
         if (start == nullptr) {
             _size++;
+            *placed = newNode;
             return newNode;
         }
 
         if (equals(newNode->_key, start->_key)) {
             start->_data = std::move(newNode->_data);
+            start->update();
             delete newNode;
+            *placed = start;
             return start;
         }
 
         if (less(newNode->_key, start->_key)) {
-            start->_left = _add(start->_left, newNode);
+            start->_left = _add(start->_left, newNode, placed);
         } else {
-            start->_right = _add(start->_right, newNode);
+            start->_right = _add(start->_right, newNode, placed);
         }
 
-        start->setHeight();
-        return _fixRotations(start);
+        return _afterAdd(start);
     }
 
-    AVLNode<K, T>* _removeGreatest(AVLNode<K, T>* start, AVLNode<K, T>** ret) {
+    AVLNode<K, T, D>* _removeGreatest(AVLNode<K, T, D>* start,
+                                                AVLNode<K, T, D>** ret) {
         if (start->_right == nullptr) {
             // we found the greatest.
             *ret = start;
@@ -140,12 +428,11 @@ private:
         }
         
         start->_right = _removeGreatest(start->_right, ret);
-        start->setHeight();
-        return _fixRotations(start);
+        return _afterRemove(start);
     }
 
-    AVLNode<K, T>* _remove(const K& key, AVLNode<K, T> *curr,
-                                                AVLNode<K, T>** ret) {
+    AVLNode<K, T, D>* _remove(const K& key, AVLNode<K, T, D> *curr,
+                                                AVLNode<K, T, D>** ret) {
         if (curr == nullptr)
             return nullptr;
 
@@ -153,10 +440,11 @@ private:
             _size--;
             *ret = curr;
             if (curr->_left && curr->_right) {
-                AVLNode<K, T>* predecessor = nullptr;
+                AVLNode<K, T, D>* predecessor = nullptr;
                 curr->_left = _removeGreatest(curr->_left, &predecessor);
                 predecessor->_left = curr->_left;
                 predecessor->_right = curr->_right;
+                predecessor->_height = curr->_height;
                 curr = predecessor;
             } else if (curr->_left) {
                 return curr->_left;
@@ -170,8 +458,158 @@ private:
             curr->_right = _remove(key, curr->_right, ret);
         }
 
-        curr->setHeight();
-        return _fixRotations(curr);
+        return _afterRemove(curr);
+    }
+
+    // Joins two valid trees around a middle node, where every key in left is
+    // less than the middle's and every key in right is greater. The heights
+    // (ranks) of left and right may differ by any amount: we walk down the
+    // spine of the taller one until the ranks match, hang the middle node
+    // there, and rebalance on the way back up.
+    AVLNode<K, T, D>* _join(AVLNode<K, T, D>* left, AVLNode<K, T, D>* middle,
+                                                    AVLNode<K, T, D>* right) {
+        if (rankOf(left) > rankOf(right) + 1)
+            return _joinRight(left, middle, right);
+        if (rankOf(right) > rankOf(left) + 1)
+            return _joinLeft(left, middle, right);
+
+        middle->_left = left;
+        middle->_right = right;
+        middle->setHeight();
+        middle->update();
+        return middle;
+    }
+
+    AVLNode<K, T, D>* _joinRight(AVLNode<K, T, D>* left,
+                                 AVLNode<K, T, D>* middle,
+                                 AVLNode<K, T, D>* right) {
+        if (rankOf(left->_right) <= rankOf(right) + 1) {
+            middle->_left = left->_right;
+            middle->_right = right;
+            middle->setHeight();
+            middle->update();
+            left->_right = middle;
+        } else {
+            left->_right = _joinRight(left->_right, middle, right);
+        }
+
+        return _afterAdd(left);
+    }
+
+    AVLNode<K, T, D>* _joinLeft(AVLNode<K, T, D>* left,
+                                AVLNode<K, T, D>* middle,
+                                AVLNode<K, T, D>* right) {
+        if (rankOf(right->_left) <= rankOf(left) + 1) {
+            middle->_left = left;
+            middle->_right = right->_left;
+            middle->setHeight();
+            middle->update();
+            right->_left = middle;
+        } else {
+            right->_left = _joinLeft(left, middle, right->_left);
+        }
+
+        return _afterAdd(right);
+    }
+
+    // Joins two trees with no middle node, by borrowing the greatest node of
+    // the left tree.
+    AVLNode<K, T, D>* _join(AVLNode<K, T, D>* left, AVLNode<K, T, D>* right) {
+        if (left == nullptr)
+            return right;
+
+        AVLNode<K, T, D>* greatest = nullptr;
+        left = _removeGreatest(left, &greatest);
+        return _join(left, greatest, right);
+    }
+
+    static const K& _keyOf(const AVLNode<K, T, D>* node) {
+        return node->_key;
+    }
+
+    static const K& _keyOf(const K& key) {
+        return key;
+    }
+
+    // Index of the first element in batch[lo, hi) whose key is not less than
+    // the given key.
+    template <class E>
+    int _lowerBound(const std::vector<E>& batch, int lo, int hi,
+                                                        const K& key) const {
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (less(_keyOf(batch[mid]), key))
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        return lo;
+    }
+
+    // Builds a perfectly balanced tree out of the sorted nodes in
+    // batch[lo, hi).
+    AVLNode<K, T, D>* _build(std::vector<AVLNode<K, T, D>*>& batch,
+                                int lo, int hi, std::vector<bool>& inserted) {
+        if (lo == hi)
+            return nullptr;
+
+        int mid = (lo + hi) / 2;
+        auto node = batch[mid];
+        node->_left = _build(batch, lo, mid, inserted);
+        node->_right = _build(batch, mid + 1, hi, inserted);
+        node->setHeight();
+        node->update();
+
+        inserted[mid] = true;
+        _size++;
+        return node;
+    }
+
+    // Splits the sorted batch[lo, hi) around start's key, sends each half
+    // down the matching side, and joins the results back together. Subtrees
+    // that no batch key falls into are left untouched, and a run that lands
+    // on an empty subtree is built into a balanced subtree in one go.
+    AVLNode<K, T, D>* _addBatch(AVLNode<K, T, D>* start,
+                                std::vector<AVLNode<K, T, D>*>& batch,
+                                int lo, int hi, std::vector<bool>& inserted) {
+        if (lo == hi)
+            return start;
+        if (start == nullptr)
+            return _build(batch, lo, hi, inserted);
+
+        int mid = _lowerBound(batch, lo, hi, start->_key);
+        bool found = mid < hi && equals(batch[mid]->_key, start->_key);
+        if (found) {
+            start->_data = std::move(batch[mid]->_data);
+            delete batch[mid];
+            inserted[mid] = false;
+        }
+
+        auto left = _addBatch(start->_left, batch, lo, mid, inserted);
+        auto right = _addBatch(start->_right, batch, found ? mid + 1 : mid, hi,
+                                inserted);
+        return _join(left, start, right);
+    }
+
+    AVLNode<K, T, D>* _removeBatch(AVLNode<K, T, D>* start,
+                                const std::vector<K>& batch,
+                                int lo, int hi, std::vector<bool>& removed) {
+        if (lo == hi || start == nullptr)
+            return start;
+
+        int mid = _lowerBound(batch, lo, hi, start->_key);
+        bool found = mid < hi && equals(batch[mid], start->_key);
+
+        auto left = _removeBatch(start->_left, batch, lo, mid, removed);
+        auto right = _removeBatch(start->_right, batch, found ? mid + 1 : mid,
+                                    hi, removed);
+        if (!found)
+            return _join(left, start, right);
+
+        removed[mid] = true;
+        _size--;
+        delete start;
+        return _join(left, right);
     }
 
     void _print(std::ostream& os) const {
@@ -185,7 +623,8 @@ private:
         _printHelper(os, _root->_right, 1);
     }
 
-    void _printHelper(std::ostream& os, AVLNode<K, T>* curr, int shift) const {
+    void _printHelper(std::ostream& os, AVLNode<K, T, D>* curr,
+                                                        int shift) const {
         os << '\n';
         for (int i = 0; i < shift; i++)
             os << '\t';
@@ -202,7 +641,7 @@ private:
         }
     }
 
-    void _clear(AVLNode<K, T>* start) {
+    void _clear(AVLNode<K, T, D>* start) {
         if (start == nullptr)
             return;
 
@@ -215,12 +654,104 @@ private:
         _clear(right);
     }
 
-    bool _equals(AVLNode<K, T>* mine, AVLNode<K, T>* his) {
-        return (mine == nullptr && his == nullptr)
-            || (mine->_key == his->_key
-                && mine->_data == his->_data
-                && _equals(mine->_left, his->_left)
-                && _equals(mine->_right, his->_right));
+    // Replaces a subtree on top of a diff stack with its left subtree, its
+    // own entry and its right subtree, so that the next entry in key order
+    // ends up on top.
+    static void _expand(
+                std::vector<std::pair<const AVLNode<K, T, D>*, bool>>& stack) {
+        auto node = stack.back().first;
+        stack.pop_back();
+        if (node->_right)
+            stack.push_back(std::make_pair(node->_right, true));
+        stack.push_back(std::make_pair(node, false));
+        if (node->_left)
+            stack.push_back(std::make_pair(node->_left, true));
+    }
+
+    // Walks both trees in key order at once, calling
+    // visit(key, mine, theirs) for every difference until visit returns
+    // false. Each side is a stack of pending work whose top is the next
+    // thing in key order: either a whole subtree (true) or a single entry
+    // (false). Subtrees are only opened up when needed. If useDigests is
+    // set, two subtrees on top with the same digest are skipped together.
+    template <class F>
+    bool _diff(const AVLTree<K, T, L, B, D>& other, bool useDigests,
+                                                            F visit) const {
+        std::vector<std::pair<const AVLNode<K, T, D>*, bool>> mine;
+        std::vector<std::pair<const AVLNode<K, T, D>*, bool>> theirs;
+        if (_root)
+            mine.push_back(std::make_pair(_root, true));
+        if (other._root)
+            theirs.push_back(std::make_pair(other._root, true));
+
+        while (mine.size() || theirs.size()) {
+            if (mine.size() && theirs.size()
+                    && mine.back().second && theirs.back().second) {
+                auto a = mine.back().first;
+                auto b = theirs.back().first;
+                if (useDigests && a->sameDigest(*b)) {
+                    mine.pop_back();
+                    theirs.pop_back();
+                } else if (a->_height >= b->_height) {
+                    // Open the taller one first, so the two sides are more
+                    // likely to line up on subtrees of the same shape.
+                    _expand(mine);
+                } else {
+                    _expand(theirs);
+                }
+                continue;
+            }
+            if (mine.size() && mine.back().second) {
+                _expand(mine);
+                continue;
+            }
+            if (theirs.size() && theirs.back().second) {
+                _expand(theirs);
+                continue;
+            }
+
+            // Both sides now have a single entry on top (or are done).
+            bool more = true;
+            if (theirs.empty() || (mine.size() && less(mine.back().first->_key,
+                                                theirs.back().first->_key))) {
+                auto a = mine.back().first;
+                mine.pop_back();
+                more = visit(a->_key, &a->_data, nullptr);
+            } else if (mine.empty() || less(theirs.back().first->_key,
+                                                mine.back().first->_key)) {
+                auto b = theirs.back().first;
+                theirs.pop_back();
+                more = visit(b->_key, nullptr, &b->_data);
+            } else {
+                auto a = mine.back().first;
+                auto b = theirs.back().first;
+                mine.pop_back();
+                theirs.pop_back();
+                if (!(a->_data == b->_data))
+                    more = visit(a->_key, &a->_data, &b->_data);
+            }
+
+            if (!more)
+                return false;
+        }
+
+        return true;
+    }
+
+    // Adds or updates an entry like add(), and returns the node now holding
+    // it.
+    AVLNode<K, T, D>* _addNode(K key, T data) {
+        auto newNode = new AVLNode<K, T, D>(0, std::move(key), std::move(data));
+
+        if (!_size) {
+            _root = newNode;
+            _size = 1;
+            return newNode;
+        }
+
+        AVLNode<K, T, D>* placed = nullptr;
+        _root = _add(_root, newNode, &placed);
+        return placed;
     }
 
 public:
@@ -228,7 +759,7 @@ public:
         _root(nullptr),
         _size(0) {}
 
-    AVLTree(AVLTree<K, T, L>& other) {
+    AVLTree(AVLTree<K, T, L, B, D>& other) {
         if (!other._size) {
             _root = nullptr;
             _size = 0;
@@ -238,22 +769,23 @@ public:
         // We are going to go through the other tree BFS style, and we are going
         // to use two parallel queues: one to hold the other tree's nodes, and
         // one to hold the next nodes that we need to create / set.
-        // The queues will have a maximum occupancy of 2 ^ height - i.e. it
-        // will maximally filled at the time when it is completely filled by the
-        // last row of the original tree. This last row will have 2 ^ height
-        // elements. Thus the queue can be an array of size 2 ^ height,
-        // i.e. 1 << height.
+        // The queues can never hold more than all of the other tree's nodes,
+        // so their size is the tree's size rounded up to a power of two. (We
+        // can't go by height(): under WAVLBalance it is a rank that can be up
+        // to twice the real height.) The queues live on the heap, since they
+        // grow with the tree.
         // We are going to implement a queue that wraps around. "i" points to
         // the current element, and "end" points to the last element. When
         // i > end, the queue is empty. (Actually, since we wrap, i % array.size
         // points to the element)
+        int capacity = 1;
+        while (capacity < other._size)
+            capacity <<= 1;
+        // i % capacity == i & mod
+        int mod = capacity - 1;
 
-        int nodesInLastRow = 1 << (other.height());
-        // i % nodesInLastRow == i & mod
-        int mod = ~((-1) << other.height());
-
-        AVLNode<K, T>* otherNodes[nodesInLastRow] = { nullptr };
-        AVLNode<K, T>** myNodes[nodesInLastRow] = { nullptr };
+        std::vector<AVLNode<K, T, D>*> otherNodes(capacity, nullptr);
+        std::vector<AVLNode<K, T, D>**> myNodes(capacity, nullptr);
 
         int end = -1; // the end of the queue, tells us when to stop.
         int i = 0; // the thing we are pointing to in the queue right now.
@@ -267,7 +799,10 @@ public:
             auto orig = otherNodes[i & mod];
             auto copy = myNodes[i & mod];
 
-            *copy = new AVLNode<K, T>(orig->_height, orig->_key, orig->_data);
+            *copy = new AVLNode<K, T, D>(orig->_height, orig->_key,
+                                            orig->_data);
+            // The copy has the same shape, so it has the same digests too.
+            static_cast<D&>(**copy) = static_cast<const D&>(*orig);
 
             if (orig->_left) {
                 end++;
@@ -286,7 +821,7 @@ public:
         _size = other._size;
     }
 
-    AVLTree(AVLTree<K, T, L>&& other) {
+    AVLTree(AVLTree<K, T, L, B, D>&& other) {
         _root = nullptr;
         _size = 0;
 
@@ -298,24 +833,24 @@ public:
 
     class Iterator : public std::iterator<std::bidirectional_iterator_tag,
                                             std::pair<const K&, T&>> {
-    friend class AVLTree<K, T, L>;
+    friend class AVLTree<K, T, L, B, D>;
     private:
         // We're going to be using the vector as a stack for in-order traversal.
         // The "bool" portion refers to whether we have covered a node. This is
         // necessary to figure out whether we need to examine it or not.
-        std::vector<std::pair<AVLNode<K, T>*, bool>> _history;
+        std::vector<std::pair<AVLNode<K, T, D>*, bool>> _history;
         int _ptr;
 
         // The methods below are used to fill the Iterator correctly - 
-        std::pair<AVLNode<K, T>*, bool>& _peek() {
+        std::pair<AVLNode<K, T, D>*, bool>& _peek() {
             return _history[_ptr];
         }
 
-        const std::pair<AVLNode<K, T>*, bool>& _cpeek() const {
+        const std::pair<AVLNode<K, T, D>*, bool>& _cpeek() const {
             return _history[_ptr];
         }
 
-        void _push(AVLNode<K, T>* node, bool covered) {
+        void _push(AVLNode<K, T, D>* node, bool covered) {
             _history.push_back(std::make_pair(node, covered));
             _ptr++;
         }
@@ -342,7 +877,7 @@ public:
             // "not covered" (we haven't visited each yet).
             // Note that if the current node didn't have a right child, the
             // statement below and the loop immediately following it do nothing.
-            AVLNode<K, T>* next = _peek().first->_right;
+            AVLNode<K, T, D>* next = _peek().first->_right;
 
             while (next) {
                 _push(next, false);
@@ -388,16 +923,47 @@ public:
         }
     };
 
-    AVLTree<K, T, L>& operator=(AVLTree<K, T, L> other) {
+    AVLTree<K, T, L, B, D>& operator=(AVLTree<K, T, L, B, D> other) {
         other.swap(*this);
         return *this;
     }
 
-    bool operator==(const AVLTree<K, T, L>& other) {
-        return _equals(_root, other._root);
+    // Two trees are equal when they hold the same entries, whatever their
+    // shapes. Every entry is compared; digests are never trusted here, so a
+    // digest collision cannot make unequal trees compare equal.
+    bool operator==(const AVLTree<K, T, L, B, D>& other) const {
+        if (_size != other._size)
+            return false;
+
+        bool same = true;
+        _diff(other, false, [&same](const K&, const T*, const T*) {
+            same = false;
+            return false;
+        });
+        return same;
+    }
+
+    // Streams the differences between this tree and other in key order,
+    // without building any intermediate list. For each key, calls
+    // visit(key, mine, theirs) with pointers to the data on each side:
+    // mine is null for a key only in other (added), theirs is null for a key
+    // only in this tree (removed), and both are set when the data differs
+    // (changed). Applying these in order turns this tree into other.
+    //
+    // With D = MerkleDigest, identical subtrees are skipped, so two large
+    // trees that differ in a few keys are compared in about
+    // O(changes * log n) instead of O(n).
+    template <class F>
+    void diff(const AVLTree<K, T, L, B, D>& other, F visit) const {
+        auto visitAll = [&visit](const K& key, const T* mine,
+                                                        const T* theirs) {
+            visit(key, mine, theirs);
+            return true;
+        };
+        _diff(other, true, visitAll);
     }
 
-    void swap(AVLTree<K, T, L>& other) {
+    void swap(AVLTree<K, T, L, B, D>& other) {
         std::swap(_root, other._root);
         std::swap(_size, other._size);
     }
@@ -411,22 +977,22 @@ public:
     }
 
     void add(K key, T data) {
-        auto newNode = new AVLNode<K, T>(0, std::move(key), std::move(data));
-
-        if (!_size) {
-            _root = newNode;
-            _size = 1;
-            return;
-        }
+        _addNode(std::move(key), std::move(data));
+    }
 
-        _root = _add(_root, newNode);
+    // Same as add(), but also returns the entry's key and data. Entries never
+    // move between nodes, so the references stay valid until the key is
+    // removed (or the tree is cleared or destroyed).
+    std::pair<const K&, T&> addEntry(K key, T data) {
+        auto node = _addNode(std::move(key), std::move(data));
+        return std::pair<const K&, T&>(node->_key, node->_data);
     }
 
     T remove(const K& key) {
         if (!_size)
             throw std::runtime_error("Empty tree: element not found.");
 
-        AVLNode<K, T>* found = nullptr;
+        AVLNode<K, T, D>* found = nullptr;
         _root = _remove(key, _root, &found);
 
         if (!found)
@@ -438,6 +1004,59 @@ public:
         return data;
     }
 
+    // Adds a run of (key, data) pairs whose keys are strictly increasing.
+    // Instead of descending from the root once per key, the run is split
+    // across each subtree it touches and the pieces are joined back
+    // together, so each affected path is rebalanced once. Returns, for each
+    // pair in order, whether its key was newly inserted (true) or already
+    // present and had its data replaced (false).
+    template <class It>
+    std::vector<bool> addBatch(It first, It last) {
+        std::vector<AVLNode<K, T, D>*> batch;
+        std::vector<bool> inserted;
+        try {
+            for (; first != last; ++first) {
+                // Make room first, so a node is never allocated without a
+                // place in the batch to free it from.
+                batch.push_back(nullptr);
+                batch.back() = new AVLNode<K, T, D>(0, first->first,
+                                                        first->second);
+                if (batch.size() > 1 && !less(batch[batch.size() - 2]->_key,
+                                                batch.back()->_key))
+                    throw std::runtime_error(
+                        "Batch keys must be strictly increasing.");
+            }
+            inserted.resize(batch.size(), false);
+        } catch (...) {
+            // Nothing has touched the tree yet, so the batch is all ours.
+            for (auto node : batch)
+                delete node;
+            throw;
+        }
+
+        _root = _addBatch(_root, batch, 0, batch.size(), inserted);
+        return inserted;
+    }
+
+    // Removes a run of strictly increasing keys, splitting it across the
+    // tree the same way addBatch() does. Unlike remove(), a missing key is
+    // not an error. Returns, for each key in order, whether it was removed.
+    template <class It>
+    std::vector<bool> removeBatch(It first, It last) {
+        std::vector<K> batch;
+        for (; first != last; ++first) {
+            batch.push_back(*first);
+            if (batch.size() > 1
+                    && !less(batch[batch.size() - 2], batch.back()))
+                throw std::runtime_error(
+                    "Batch keys must be strictly increasing.");
+        }
+
+        std::vector<bool> removed(batch.size(), false);
+        _root = _removeBatch(_root, batch, 0, batch.size(), removed);
+        return removed;
+    }
+
     T& get(const K& key) {
         auto curr = _root;
         while (curr != nullptr) {
@@ -490,6 +1109,8 @@ public:
         return _size;
     }
 
+    // The rank of the root. Under AVLBalance this is the exact height; under
+    // WAVLBalance it is an upper bound on it.
     int height() const {
         return (_root) ? _root->_height : -1;
     }
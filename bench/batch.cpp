@@ -0,0 +1,95 @@
+// Compares AVLTree::addBatch() and removeBatch() against adding and
+// removing the same keys one at a time.
+//
+// Build and run from the repository root:
+//
+//     g++ -std=c++14 -O2 -DNDEBUG bench/batch.cpp -o batch_bench
+//     ./batch_bench [tree size] [batch size] [rounds]
+//
+// Defaults are a 1M key tree and 200 rounds of 4000 keys. Each round picks
+// a random start and builds the sorted run start, start + 3, start + 6, ...
+// It adds the run to two copies of the tree, one with addBatch() and one
+// with an add() loop, then removes it again with removeBatch() and with a
+// remove() loop, so both trees keep their size from round to round.
+
+#include "../avl.h"
+
+#include <chrono>
+#include <climits>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <utility>
+#include <vector>
+
+using namespace vk_data;
+
+namespace {
+typedef std::chrono::steady_clock Clock;
+
+double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+} // namespace
+
+int main(int argc, char** argv) {
+    int treeSize = argc > 1 ? std::atoi(argv[1]) : 1000000;
+    int batchSize = argc > 2 ? std::atoi(argv[2]) : 4000;
+    int rounds = argc > 3 ? std::atoi(argv[3]) : 200;
+    const int stride = 3;
+
+    std::mt19937 rng(1);
+    AVLTree<int, int> batched;
+    AVLTree<int, int> looped;
+    for (int i = 0; i < treeSize; i++) {
+        int key = rng();
+        batched.add(key, i);
+        looped.add(key, i);
+    }
+
+    double addBatch = 0, addLoop = 0, removeBatch = 0, removeLoop = 0;
+    std::vector<std::pair<int, int>> run(batchSize);
+    std::vector<int> keys(batchSize);
+    std::uniform_int_distribution<int> start(0, INT_MAX - stride * batchSize);
+
+    for (int round = 0; round < rounds; round++) {
+        int base = start(rng);
+        for (int i = 0; i < batchSize; i++) {
+            keys[i] = base + i * stride;
+            run[i] = std::make_pair(keys[i], i);
+        }
+
+        auto t = Clock::now();
+        batched.addBatch(run.begin(), run.end());
+        addBatch += secondsSince(t);
+
+        t = Clock::now();
+        for (auto& entry : run)
+            looped.add(entry.first, entry.second);
+        addLoop += secondsSince(t);
+
+        t = Clock::now();
+        batched.removeBatch(keys.begin(), keys.end());
+        removeBatch += secondsSince(t);
+
+        t = Clock::now();
+        for (int key : keys)
+            looped.remove(key);
+        removeLoop += secondsSince(t);
+    }
+
+    if (batched.size() != looped.size()) {
+        std::cerr << "trees diverged\n";
+        return 1;
+    }
+
+    double total = static_cast<double>(batchSize) * rounds;
+    std::cout << "tree " << treeSize << ", " << rounds << " rounds of "
+        << batchSize << " keys\n"
+        << "  addBatch    " << total / addBatch / 1e6 << " M keys/s\n"
+        << "  add loop    " << total / addLoop / 1e6 << " M keys/s\n"
+        << "  removeBatch " << total / removeBatch / 1e6 << " M keys/s\n"
+        << "  remove loop " << total / removeLoop / 1e6 << " M keys/s\n";
+
+    return 0;
+}
@@ -0,0 +1,94 @@
+// Compares BTree against AVLTree on insert, point lookup and range-scan
+// throughput, for int keys and data.
+//
+// Build and run from the repository root:
+//
+//     g++ -std=c++14 -O2 -DNDEBUG bench/btree.cpp -o btree_bench
+//     ./btree_bench                      # 1M and 4M keys
+//     ./btree_bench 1000000 100000000    # any key counts
+//
+// Each key count builds both trees from the same random keys. Lookup does
+// 2M get() calls on keys that are in the tree; scan does 2000 find() calls
+// and walks up to 1000 entries forward from each.
+
+#include "../avl.h"
+#include "../btree.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace vk_data;
+
+namespace {
+typedef std::chrono::steady_clock Clock;
+
+double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+template <class Tree>
+void run(const char* name, const std::vector<int>& keys) {
+    const int lookups = 2000000;
+    const int scans = 2000;
+    const int scanLength = 1000;
+    int n = keys.size();
+
+    Tree* tree = new Tree();
+    auto start = Clock::now();
+    for (int i = 0; i < n; i++)
+        tree->add(keys[i], i);
+    double insert = secondsSince(start);
+
+    std::vector<int> probes(keys);
+    std::shuffle(probes.begin(), probes.end(), std::mt19937(1));
+
+    long long sum = 0;
+    start = Clock::now();
+    for (int i = 0; i < lookups; i++)
+        sum += tree->get(probes[i % n]);
+    double lookup = secondsSince(start);
+
+    long long scanned = 0;
+    start = Clock::now();
+    for (int i = 0; i < scans; i++) {
+        auto it = tree->find(probes[i % n]);
+        for (int j = 0; j < scanLength && it != tree->end(); j++, ++it) {
+            sum += (*it).second;
+            scanned++;
+        }
+    }
+    double scan = secondsSince(start);
+
+    std::cout << name << " n=" << n
+        << "  insert " << n / insert / 1e6 << " M/s"
+        << "  lookup " << lookups / lookup / 1e6 << " M/s"
+        << "  scan " << scanned / scan / 1e6 << " M/s"
+        << "  (checksum " << sum % 1000 << ")\n";
+
+    delete tree;
+}
+} // namespace
+
+int main(int argc, char** argv) {
+    std::vector<long> counts;
+    for (int i = 1; i < argc; i++)
+        counts.push_back(std::atol(argv[i]));
+    if (counts.empty())
+        counts = { 1000000, 4000000 };
+
+    for (long n : counts) {
+        std::mt19937 rng(42);
+        std::vector<int> keys(n);
+        for (auto& key : keys)
+            key = rng();
+
+        run<AVLTree<int, int>>("AVLTree", keys);
+        run<BTree<int, int>>("BTree  ", keys);
+    }
+
+    return 0;
+}
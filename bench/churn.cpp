@@ -0,0 +1,166 @@
+// Compares the AVLBalance and WAVLBalance policies under churn: throughput
+// and how many rotations each performs.
+//
+// Build and run from the repository root:
+//
+//     g++ -std=c++14 -O2 -DNDEBUG bench/churn.cpp -o churn_bench
+//     ./churn_bench                   # 100K and 1M keys
+//     ./churn_bench 10000000          # any key counts
+//
+// For each key count n the tree is built with n keys, then churned with 2n
+// remove + add pairs (a random key out, a fresh one in), then drained by
+// removing every key. The same sequence runs twice per policy: once with
+// the plain policy for timing, and once wrapped in CountingBalance to count
+// rotations.
+
+#include "../avl.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace vk_data;
+
+namespace {
+typedef std::chrono::steady_clock Clock;
+
+double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Forwards to the policy B and counts the rotations it made. A rebalance
+// step that returns a child of the node made a single rotation; one that
+// returns a grandchild made a double rotation.
+template <class B>
+struct CountingBalance {
+    static long long rotations;
+
+    template <class N>
+    static N* afterAdd(N* node) {
+        auto left = node->_left;
+        auto right = node->_right;
+        auto top = B::afterAdd(node);
+        _count(node, left, right, top);
+        return top;
+    }
+
+    template <class N>
+    static N* afterRemove(N* node) {
+        auto left = node->_left;
+        auto right = node->_right;
+        auto top = B::afterRemove(node);
+        _count(node, left, right, top);
+        return top;
+    }
+
+private:
+    template <class N>
+    static void _count(N* node, N* left, N* right, N* top) {
+        if (top == node)
+            return;
+        rotations += (top == left || top == right) ? 1 : 2;
+    }
+};
+
+template <class B>
+long long CountingBalance<B>::rotations = 0;
+
+struct Stats {
+    double churnSeconds = 0;
+    double drainSeconds = 0;
+    long long addRotations = 0;
+    long long removeRotations = 0;
+    long long drainRotations = 0;
+    long long maxRemoveRotations = 0;
+};
+
+// Every key is distinct: multiplying by an odd constant is a bijection on
+// 32-bit integers.
+int nthKey(unsigned counter) {
+    return static_cast<int>(counter * 2654435761u);
+}
+
+// Runs the build / churn / drain sequence on a tree balanced by B. When
+// counter is non-null it is read around each operation to attribute
+// rotations to adds and removes.
+template <class B>
+Stats churn(int n, const long long* counter) {
+    Stats stats;
+    std::mt19937 rng(7);
+    unsigned next = 0;
+    auto rotationsNow = [counter]() { return counter ? *counter : 0; };
+
+    AVLTree<int, int, std::less<int>, B> tree;
+    std::vector<int> keys(n);
+    for (int i = 0; i < n; i++) {
+        keys[i] = nthKey(next++);
+        tree.add(keys[i], i);
+    }
+
+    auto t = Clock::now();
+    for (int i = 0; i < 2 * n; i++) {
+        int j = rng() % n;
+
+        long long before = rotationsNow();
+        tree.remove(keys[j]);
+        long long made = rotationsNow() - before;
+        stats.removeRotations += made;
+        stats.maxRemoveRotations = std::max(stats.maxRemoveRotations, made);
+
+        keys[j] = nthKey(next++);
+        before = rotationsNow();
+        tree.add(keys[j], i);
+        stats.addRotations += rotationsNow() - before;
+    }
+    stats.churnSeconds = secondsSince(t);
+
+    t = Clock::now();
+    for (int key : keys) {
+        long long before = rotationsNow();
+        tree.remove(key);
+        long long made = rotationsNow() - before;
+        stats.drainRotations += made;
+        stats.maxRemoveRotations = std::max(stats.maxRemoveRotations, made);
+    }
+    stats.drainSeconds = secondsSince(t);
+
+    return stats;
+}
+
+template <class B>
+void run(const char* name, int n) {
+    Stats timed = churn<B>(n, nullptr);
+    Stats counted = churn<CountingBalance<B>>(n,
+            &CountingBalance<B>::rotations);
+
+    std::cout << name << " n=" << n
+        << "\n  churn: " << 4.0 * n / timed.churnSeconds / 1e6 << " M ops/s"
+        << ", rotations/remove "
+        << static_cast<double>(counted.removeRotations) / (2 * n)
+        << ", rotations/add "
+        << static_cast<double>(counted.addRotations) / (2 * n)
+        << "\n  drain: " << n / timed.drainSeconds / 1e6 << " M ops/s"
+        << ", rotations/remove "
+        << static_cast<double>(counted.drainRotations) / n
+        << "\n  max rotations in one remove: "
+        << counted.maxRemoveRotations << "\n";
+}
+} // namespace
+
+int main(int argc, char** argv) {
+    std::vector<int> counts;
+    for (int i = 1; i < argc; i++)
+        counts.push_back(std::atoi(argv[i]));
+    if (counts.empty())
+        counts = { 100000, 1000000 };
+
+    for (int n : counts) {
+        run<AVLBalance>("AVLBalance ", n);
+        run<WAVLBalance>("WAVLBalance", n);
+    }
+
+    return 0;
+}
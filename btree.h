@@ -0,0 +1,657 @@
+#pragma once
+
+#include <utility>
+#include <stdexcept>
+#include <vector>
+#include <functional>
+#include <sstream>
+#include <new>
+
+namespace vk_data {
+namespace {
+// The default minimum degree aims for a node whose key array spans roughly
+// four 64-byte cache lines, so that a binary search inside a node touches
+// only a handful of lines. Pass a larger degree for page-sized nodes.
+template <class K>
+constexpr int defaultBTreeDegree() {
+    return (256 / sizeof(K)) / 2 < 2 ? 2 : (256 / sizeof(K)) / 2;
+}
+
+template <class K, class T, int D>
+class BTreeInternalNode;
+
+// A node holds between D - 1 and 2D - 1 keys (the root may hold fewer). The
+// keys and data are kept in separate arrays so that searching a node only
+// walks the keys.
+//
+// The arrays are raw storage: only slots [0, _count) hold live objects, so
+// K and T need not be default-constructible, and an empty slot costs
+// nothing to create. Leaves are plain BTreeNodes; only BTreeInternalNode
+// carries child pointers.
+template <class K, class T, int D>
+class BTreeNode {
+public:
+    int _count;
+    bool _leaf;
+    alignas(K) unsigned char _keys[(2 * D - 1) * sizeof(K)];
+    alignas(T) unsigned char _data[(2 * D - 1) * sizeof(T)];
+
+    explicit BTreeNode(bool leaf) :
+        _count(0),
+        _leaf(leaf) {}
+
+    ~BTreeNode() {
+        for (int i = 0; i < _count; i++)
+            destroy(i);
+    }
+
+    BTreeNode(const BTreeNode&) = delete;
+    BTreeNode& operator=(const BTreeNode&) = delete;
+
+    K& key(int i) {
+        return reinterpret_cast<K*>(_keys)[i];
+    }
+
+    const K& key(int i) const {
+        return reinterpret_cast<const K*>(_keys)[i];
+    }
+
+    T& data(int i) {
+        return reinterpret_cast<T*>(_data)[i];
+    }
+
+    const T& data(int i) const {
+        return reinterpret_cast<const T*>(_data)[i];
+    }
+
+    BTreeNode<K, T, D>** children();
+    BTreeNode<K, T, D>* const* children() const;
+
+    // Constructs an entry in the empty slot i. Does not change _count.
+    template <class KK, class TT>
+    void construct(int i, KK&& key, TT&& data) {
+        new (&this->key(i)) K(std::forward<KK>(key));
+        new (&this->data(i)) T(std::forward<TT>(data));
+    }
+
+    // Destroys the entry in slot i, leaving it empty. Does not change _count.
+    void destroy(int i) {
+        key(i).~K();
+        data(i).~T();
+    }
+
+    // Moves the entry in slot j of other into the empty slot i, leaving
+    // other's slot empty.
+    void moveFrom(int i, BTreeNode<K, T, D>* other, int j) {
+        construct(i, std::move(other->key(j)), std::move(other->data(j)));
+        other->destroy(j);
+    }
+
+    // Inserts an entry at i, shifting the entries after it right by one.
+    template <class KK, class TT>
+    void insertAt(int i, KK&& key, TT&& data) {
+        for (int j = _count; j > i; j--)
+            moveFrom(j, this, j - 1);
+        construct(i, std::forward<KK>(key), std::forward<TT>(data));
+        _count++;
+    }
+
+    // Removes the entry at i, shifting the entries after it left by one.
+    // Does not touch the children.
+    void eraseAt(int i) {
+        destroy(i);
+        for (int j = i; j < _count - 1; j++)
+            moveFrom(j, this, j + 1);
+        _count--;
+    }
+};
+
+template <class K, class T, int D>
+class BTreeInternalNode : public BTreeNode<K, T, D> {
+public:
+    BTreeNode<K, T, D>* _children[2 * D];
+
+    explicit BTreeInternalNode() :
+        BTreeNode<K, T, D>(false) {}
+};
+
+template <class K, class T, int D>
+BTreeNode<K, T, D>** BTreeNode<K, T, D>::children() {
+    return static_cast<BTreeInternalNode<K, T, D>*>(this)->_children;
+}
+
+template <class K, class T, int D>
+BTreeNode<K, T, D>* const* BTreeNode<K, T, D>::children() const {
+    return static_cast<const BTreeInternalNode<K, T, D>*>(this)->_children;
+}
+} // namespace
+
+template <class K, class T, class L = std::less<K>,
+            int D = defaultBTreeDegree<K>()>
+class BTree {
+    static_assert(D >= 2, "A B-tree needs a minimum degree of at least 2.");
+
+private:
+    L _less;
+    BTreeNode<K, T, D>* _root;
+    int _size;
+
+    bool less(const K& k1, const K& k2) const {
+        return _less(k1, k2);
+    }
+
+    bool equals(const K& k1, const K& k2) const {
+        return !_less(k1, k2) && !_less(k2, k1);
+    }
+
+    static BTreeNode<K, T, D>* _newNode(bool leaf) {
+        if (leaf)
+            return new BTreeNode<K, T, D>(true);
+        return new BTreeInternalNode<K, T, D>();
+    }
+
+    // Nodes have no virtual destructor, so free them through their real type.
+    static void _freeNode(BTreeNode<K, T, D>* node) {
+        if (node->_leaf)
+            delete node;
+        else
+            delete static_cast<BTreeInternalNode<K, T, D>*>(node);
+    }
+
+    // Returns the index of the first key in the node that is not less than
+    // the given key, i.e. the slot the key lives in or the child to descend.
+    int _lowerBound(const BTreeNode<K, T, D>* node, const K& key) const {
+        int lo = 0;
+        int hi = node->_count;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (less(node->key(mid), key))
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        return lo;
+    }
+
+    const BTreeNode<K, T, D>* _findNode(const K& key, int* idx) const {
+        const BTreeNode<K, T, D>* curr = _root;
+        while (curr != nullptr) {
+            int i = _lowerBound(curr, key);
+            if (i < curr->_count && equals(key, curr->key(i))) {
+                *idx = i;
+                return curr;
+            }
+            curr = curr->_leaf ? nullptr : curr->children()[i];
+        }
+        return nullptr;
+    }
+
+    // Splits the full child at index i of parent. The upper half of the child
+    // moves to a new sibling, and the median key moves up into the parent.
+    void _splitChild(BTreeNode<K, T, D>* parent, int i) {
+        auto full = parent->children()[i];
+        auto sibling = _newNode(full->_leaf);
+
+        for (int j = 0; j < D - 1; j++)
+            sibling->moveFrom(j, full, j + D);
+        sibling->_count = D - 1;
+        if (!full->_leaf) {
+            for (int j = 0; j < D; j++)
+                sibling->children()[j] = full->children()[j + D];
+        }
+
+        for (int j = parent->_count; j > i; j--)
+            parent->children()[j + 1] = parent->children()[j];
+        parent->children()[i + 1] = sibling;
+
+        parent->insertAt(i, std::move(full->key(D - 1)),
+                            std::move(full->data(D - 1)));
+        full->destroy(D - 1);
+        full->_count = D - 1;
+    }
+
+    // Inserts into a node that is known not to be full, splitting full
+    // children on the way down so that we never need to walk back up.
+    void _addNonFull(BTreeNode<K, T, D>* node, K& key, T& data) {
+        while (true) {
+            int i = _lowerBound(node, key);
+            if (i < node->_count && equals(key, node->key(i))) {
+                node->data(i) = std::move(data);
+                return;
+            }
+
+            if (node->_leaf) {
+                node->insertAt(i, std::move(key), std::move(data));
+                _size++;
+                return;
+            }
+
+            if (node->children()[i]->_count == 2 * D - 1) {
+                _splitChild(node, i);
+                // The median that moved up may be the key itself, or the key
+                // may now belong in the new right sibling.
+                if (equals(key, node->key(i))) {
+                    node->data(i) = std::move(data);
+                    return;
+                }
+                if (less(node->key(i), key))
+                    i++;
+            }
+            node = node->children()[i];
+        }
+    }
+
+    // Merges child i + 1 and the separating key i into child i.
+    void _merge(BTreeNode<K, T, D>* node, int i) {
+        auto left = node->children()[i];
+        auto right = node->children()[i + 1];
+
+        left->construct(left->_count, std::move(node->key(i)),
+                        std::move(node->data(i)));
+        for (int j = 0; j < right->_count; j++)
+            left->moveFrom(left->_count + 1 + j, right, j);
+        if (!left->_leaf) {
+            for (int j = 0; j <= right->_count; j++)
+                left->children()[left->_count + 1 + j] = right->children()[j];
+        }
+        left->_count += right->_count + 1;
+        right->_count = 0;
+
+        node->eraseAt(i);
+        for (int j = i + 1; j <= node->_count; j++)
+            node->children()[j] = node->children()[j + 1];
+
+        _freeNode(right);
+    }
+
+    // Makes sure child i has at least D keys before we descend into it, by
+    // borrowing from a sibling or merging with one. Returns the index of the
+    // child to descend into, which moves left if we merged with the left
+    // sibling.
+    int _fill(BTreeNode<K, T, D>* node, int i) {
+        auto child = node->children()[i];
+        if (child->_count >= D)
+            return i;
+
+        if (i > 0 && node->children()[i - 1]->_count >= D) {
+            // Borrow from the left sibling through the parent.
+            auto left = node->children()[i - 1];
+            int last = left->_count - 1;
+            if (!child->_leaf) {
+                for (int j = child->_count + 1; j > 0; j--)
+                    child->children()[j] = child->children()[j - 1];
+                child->children()[0] = left->children()[left->_count];
+            }
+            child->insertAt(0, std::move(node->key(i - 1)),
+                                std::move(node->data(i - 1)));
+
+            node->key(i - 1) = std::move(left->key(last));
+            node->data(i - 1) = std::move(left->data(last));
+            left->eraseAt(last);
+            return i;
+        }
+
+        if (i < node->_count && node->children()[i + 1]->_count >= D) {
+            // Borrow from the right sibling through the parent.
+            auto right = node->children()[i + 1];
+            child->construct(child->_count, std::move(node->key(i)),
+                                std::move(node->data(i)));
+            if (!child->_leaf)
+                child->children()[child->_count + 1] = right->children()[0];
+            child->_count++;
+
+            node->key(i) = std::move(right->key(0));
+            node->data(i) = std::move(right->data(0));
+            if (!right->_leaf) {
+                for (int j = 0; j < right->_count; j++)
+                    right->children()[j] = right->children()[j + 1];
+            }
+            right->eraseAt(0);
+            return i;
+        }
+
+        // Merge with a sibling; the last child has no right sibling.
+        if (i == node->_count)
+            i--;
+        _merge(node, i);
+        return i;
+    }
+
+    void _removeGreatest(BTreeNode<K, T, D>* node, K* key, T* data) {
+        while (!node->_leaf)
+            node = node->children()[_fill(node, node->_count)];
+
+        int last = node->_count - 1;
+        *key = std::move(node->key(last));
+        *data = std::move(node->data(last));
+        node->eraseAt(last);
+    }
+
+    void _removeLeast(BTreeNode<K, T, D>* node, K* key, T* data) {
+        while (!node->_leaf)
+            node = node->children()[_fill(node, 0)];
+
+        *key = std::move(node->key(0));
+        *data = std::move(node->data(0));
+        node->eraseAt(0);
+    }
+
+    // Descends towards the key, topping up every node we enter to at least D
+    // keys, so that removing from it afterwards can never leave it
+    // underfull. Returns the node holding the key (and its index), or
+    // nullptr if the key is not in the tree.
+    BTreeNode<K, T, D>* _findForRemove(const K& key, int* idx) {
+        auto node = _root;
+        while (true) {
+            int i = _lowerBound(node, key);
+            if (i < node->_count && equals(key, node->key(i))) {
+                *idx = i;
+                return node;
+            }
+
+            if (node->_leaf)
+                return nullptr;
+
+            node = node->children()[_fill(node, i)];
+        }
+    }
+
+    // Drops the (already moved-from) slot i of a node that has at least D
+    // keys. In an internal node the slot is refilled with its predecessor or
+    // successor; if both neighbouring children are minimal, they are merged
+    // around the slot and we carry on from the merged child.
+    void _removeSlot(BTreeNode<K, T, D>* node, int i) {
+        while (!node->_leaf) {
+            if (node->children()[i]->_count >= D) {
+                _removeGreatest(node->children()[i],
+                                &node->key(i), &node->data(i));
+                return;
+            }
+            if (node->children()[i + 1]->_count >= D) {
+                _removeLeast(node->children()[i + 1],
+                                &node->key(i), &node->data(i));
+                return;
+            }
+            _merge(node, i);
+            node = node->children()[i];
+            i = D - 1;
+        }
+        node->eraseAt(i);
+    }
+
+    // A merge at the root may have left it empty; the tree then shrinks by
+    // one level.
+    void _shrinkRoot() {
+        if (_root->_count)
+            return;
+
+        auto oldRoot = _root;
+        _root = _root->_leaf ? nullptr : _root->children()[0];
+        _freeNode(oldRoot);
+    }
+
+    BTreeNode<K, T, D>* _copy(const BTreeNode<K, T, D>* orig) {
+        auto copy = _newNode(orig->_leaf);
+        for (int i = 0; i < orig->_count; i++) {
+            copy->construct(i, orig->key(i), orig->data(i));
+            copy->_count++;
+        }
+        if (!orig->_leaf) {
+            for (int i = 0; i <= orig->_count; i++)
+                copy->children()[i] = _copy(orig->children()[i]);
+        }
+        return copy;
+    }
+
+    void _clear(BTreeNode<K, T, D>* start) {
+        if (!start->_leaf) {
+            for (int i = 0; i <= start->_count; i++)
+                _clear(start->children()[i]);
+        }
+        _freeNode(start);
+    }
+
+    void _printHelper(std::ostream& os, const BTreeNode<K, T, D>* curr,
+                                                            int shift) const {
+        if (shift)
+            os << '\n';
+        for (int i = 0; i < shift; i++)
+            os << '\t';
+        os << "|---[";
+        for (int i = 0; i < curr->_count; i++) {
+            if (i)
+                os << ", ";
+            os << '<' << curr->key(i) << ", " << curr->data(i) << '>';
+        }
+        os << ']';
+        if (!curr->_leaf) {
+            for (int i = 0; i <= curr->_count; i++)
+                _printHelper(os, curr->children()[i], shift + 1);
+        }
+    }
+
+    void _print(std::ostream& os) const {
+        if (!_size) {
+            os << "<empty tree>";
+            return;
+        }
+
+        _printHelper(os, _root, 0);
+    }
+
+public:
+    explicit BTree() :
+        _root(nullptr),
+        _size(0) {}
+
+    BTree(const BTree<K, T, L, D>& other) :
+        _less(other._less),
+        _root(other._root ? _copy(other._root) : nullptr),
+        _size(other._size) {}
+
+    BTree(BTree<K, T, L, D>&& other) :
+        _less(std::move(other._less)),
+        _root(nullptr),
+        _size(0) {
+        std::swap(_root, other._root);
+        std::swap(_size, other._size);
+    }
+
+    ~BTree() { clear(); }
+
+    class Iterator : public std::iterator<std::forward_iterator_tag,
+                                            std::pair<const K&, T&>> {
+    friend class BTree<K, T, L, D>;
+    private:
+        // The path from the root to the current key. Each entry holds a node
+        // and the index of the next key to visit in it; for the node on top
+        // of the stack that is the current key. For the nodes below it, the
+        // index names the key that follows the child we descended into.
+        std::vector<std::pair<BTreeNode<K, T, D>*, int>> _history;
+
+        void _pushLeftmost(BTreeNode<K, T, D>* node) {
+            while (true) {
+                _history.push_back(std::make_pair(node, 0));
+                if (node->_leaf)
+                    return;
+                node = node->children()[0];
+            }
+        }
+
+    public:
+        explicit Iterator() {};
+
+        Iterator& operator++() {
+            if (!_history.size())
+                throw std::runtime_error("Can't iterate past end().");
+
+            auto& top = _history.back();
+            top.second++;
+
+            // In an internal node, the successor of key i is the leftmost key
+            // of child i + 1.
+            if (!top.first->_leaf) {
+                _pushLeftmost(top.first->children()[top.second]);
+                return *this;
+            }
+
+            // Otherwise climb until we find a node with keys left to visit.
+            while (_history.size()
+                    && _history.back().second >= _history.back().first->_count)
+                _history.pop_back();
+
+            return *this;
+        }
+
+        Iterator operator++(int) {
+            auto ret = *this;
+            ++(*this);
+            return ret;
+        }
+
+        bool operator==(const Iterator& other) const {
+            return _history.size() == other._history.size() &&
+                (!_history.size() ? true
+                    : (_history.back() == other._history.back()));
+        }
+
+        bool operator!=(const Iterator& other) const {
+            return !(*this == other);
+        }
+
+        std::pair<const K&, T&> operator*() {
+            if (!_history.size())
+                throw std::runtime_error("Cannot dereference end() iterator.");
+
+            auto& top = _history.back();
+            return std::pair<const K&, T&>(top.first->key(top.second),
+                                    top.first->data(top.second));
+        }
+    };
+
+    BTree<K, T, L, D>& operator=(BTree<K, T, L, D> other) {
+        other.swap(*this);
+        return *this;
+    }
+
+    void swap(BTree<K, T, L, D>& other) {
+        std::swap(_less, other._less);
+        std::swap(_root, other._root);
+        std::swap(_size, other._size);
+    }
+
+    void clear() {
+        if (_root)
+            _clear(_root);
+        _root = nullptr;
+        _size = 0;
+    }
+
+    void add(K key, T data) {
+        if (!_root)
+            _root = _newNode(true);
+
+        if (_root->_count == 2 * D - 1) {
+            // Grow the tree from the top: the old root becomes the only child
+            // of a new root, and is then split in two.
+            auto newRoot = _newNode(false);
+            newRoot->children()[0] = _root;
+            _root = newRoot;
+            _splitChild(_root, 0);
+        }
+
+        _addNonFull(_root, key, data);
+    }
+
+    T remove(const K& key) {
+        if (!_size)
+            throw std::runtime_error("Empty tree: element not found.");
+
+        int i = 0;
+        auto node = _findForRemove(key, &i);
+        if (node == nullptr) {
+            _shrinkRoot();
+            throw std::runtime_error("Element not found!");
+        }
+
+        // Move the data straight out of its slot; the slot itself is then
+        // refilled or dropped.
+        T data = std::move(node->data(i));
+        _removeSlot(node, i);
+        _shrinkRoot();
+
+        _size--;
+        return data;
+    }
+
+    T& get(const K& key) {
+        return const_cast<T&>(static_cast<const BTree<K, T, L, D>*>(this)
+                                ->get(key));
+    }
+
+    const T& get(const K& key) const {
+        int i = 0;
+        auto node = _findNode(key, &i);
+
+        if (node == nullptr)
+            throw std::runtime_error("Element not found.");
+
+        return node->data(i);
+    }
+
+    bool contains(const K& key) const {
+        int i = 0;
+        return _findNode(key, &i) != nullptr;
+    }
+
+    int size() const {
+        return _size;
+    }
+
+    int height() const {
+        if (!_root)
+            return -1;
+
+        int h = 0;
+        for (auto curr = _root; !curr->_leaf; curr = curr->children()[0])
+            h++;
+        return h;
+    }
+
+    Iterator begin() {
+        if (!_size)
+            return end();
+
+        Iterator ret;
+        ret._pushLeftmost(_root);
+        return ret;
+    }
+
+    Iterator end() {
+        return Iterator();
+    }
+
+    Iterator find(const K& key) {
+        if (!_size)
+            return end();
+
+        Iterator ret;
+
+        auto curr = _root;
+        while (true) {
+            int i = _lowerBound(curr, key);
+            ret._history.push_back(std::make_pair(curr, i));
+            if (i < curr->_count && equals(key, curr->key(i)))
+                return ret;
+            if (curr->_leaf)
+                return end();
+            curr = curr->children()[i];
+        }
+    }
+
+    friend std::ostream& operator<<(std::ostream& os, const BTree& tree) {
+        tree._print(os);
+        return os;
+    }
+};
+} // namespace vk_data
@@ -0,0 +1,239 @@
+#pragma once
+
+#include <utility>
+#include <stdexcept>
+#include <vector>
+#include <functional>
+#include <sstream>
+
+#include "avl.h"
+
+namespace vk_data {
+
+// An AVLTree with an open-addressing hash index on the side. The tree keeps
+// the keys ordered for iteration and find(), while get() and contains() are
+// answered from the index with a single probe sequence.
+//
+// The index points straight at the keys and data inside the tree's nodes.
+// AVLTree never moves an entry to a different node (rotations and removals
+// only relink nodes), so these pointers stay valid until the key is removed.
+//
+// H must agree with L: keys that L considers equal must hash equally.
+template <class K, class T, class L = std::less<K>, class H = std::hash<K>>
+class HashedAVLTree {
+private:
+    struct Slot {
+        const K* _key;
+        T* _data;
+        std::size_t _hash;
+
+        explicit Slot() :
+            _key(nullptr),
+            _data(nullptr),
+            _hash(0) {}
+    };
+
+    AVLTree<K, T, L> _tree;
+    L _less;
+    H _hasher;
+    // Linear probing over a power of two number of slots. An empty slot has
+    // a null _key. Removals shift later entries back instead of leaving
+    // tombstones, so a probe always stops at the first empty slot.
+    std::vector<Slot> _slots;
+
+    bool equals(const K& k1, const K& k2) const {
+        return !_less(k1, k2) && !_less(k2, k1);
+    }
+
+    std::size_t _mask() const {
+        return _slots.size() - 1;
+    }
+
+    // Returns the slot holding the key, or the empty slot where it would go.
+    std::size_t _probe(const K& key, std::size_t hash) const {
+        std::size_t i = hash & _mask();
+        while (_slots[i]._key
+                && !(_slots[i]._hash == hash && equals(*_slots[i]._key, key)))
+            i = (i + 1) & _mask();
+        return i;
+    }
+
+    const Slot* _lookup(const K& key) const {
+        if (_slots.empty())
+            return nullptr;
+
+        auto& slot = _slots[_probe(key, _hasher(key))];
+        return slot._key ? &slot : nullptr;
+    }
+
+    void _insertSlot(const K* key, T* data, std::size_t hash) {
+        auto& slot = _slots[_probe(*key, hash)];
+        slot._key = key;
+        slot._data = data;
+        slot._hash = hash;
+    }
+
+    void _eraseSlot(std::size_t i) {
+        // Backward shift deletion: pull later entries of the probe run into
+        // the hole as long as that does not move them before their home.
+        std::size_t hole = i;
+        std::size_t j = i;
+        while (true) {
+            j = (j + 1) & _mask();
+            if (!_slots[j]._key)
+                break;
+            std::size_t home = _slots[j]._hash & _mask();
+            if (((j - home) & _mask()) >= ((j - hole) & _mask())) {
+                _slots[hole] = _slots[j];
+                hole = j;
+            }
+        }
+        _slots[hole] = Slot();
+    }
+
+    // Keeps the load factor at or below one half.
+    void _reserve(int count) {
+        std::size_t wanted = 8;
+        while (wanted < 2 * static_cast<std::size_t>(count))
+            wanted <<= 1;
+        if (wanted <= _slots.size())
+            return;
+
+        std::vector<Slot> old(wanted);
+        old.swap(_slots);
+        for (auto& slot : old) {
+            if (slot._key)
+                _insertSlot(slot._key, slot._data, slot._hash);
+        }
+    }
+
+    void _reindex() {
+        _slots.clear();
+        _reserve(_tree.size());
+        for (auto it = _tree.begin(); it != _tree.end(); ++it) {
+            auto entry = *it;
+            _insertSlot(&entry.first, &entry.second, _hasher(entry.first));
+        }
+    }
+
+public:
+    explicit HashedAVLTree() {}
+
+    HashedAVLTree(HashedAVLTree<K, T, L, H>& other) :
+        _tree(other._tree),
+        _less(other._less),
+        _hasher(other._hasher) {
+        // The copied tree has its own nodes, so the index is rebuilt.
+        _reindex();
+    }
+
+    HashedAVLTree(HashedAVLTree<K, T, L, H>&& other) :
+        _tree(std::move(other._tree)),
+        _less(std::move(other._less)),
+        _hasher(std::move(other._hasher)),
+        _slots(std::move(other._slots)) {
+        other._slots.clear();
+    }
+
+    typedef typename AVLTree<K, T, L>::Iterator Iterator;
+
+    HashedAVLTree<K, T, L, H>& operator=(HashedAVLTree<K, T, L, H> other) {
+        other.swap(*this);
+        return *this;
+    }
+
+    void swap(HashedAVLTree<K, T, L, H>& other) {
+        _tree.swap(other._tree);
+        std::swap(_less, other._less);
+        std::swap(_hasher, other._hasher);
+        _slots.swap(other._slots);
+    }
+
+    void clear() {
+        _tree.clear();
+        _slots.clear();
+    }
+
+    void add(K key, T data) {
+        std::size_t hash = _hasher(key);
+
+        if (!_slots.empty()) {
+            auto& slot = _slots[_probe(key, hash)];
+            if (slot._key) {
+                // Replacing the data of an existing key leaves the tree's
+                // shape alone, so there is no need to descend it.
+                *slot._data = std::move(data);
+                return;
+            }
+        }
+
+        _reserve(_tree.size() + 1);
+        auto entry = _tree.addEntry(std::move(key), std::move(data));
+        _insertSlot(&entry.first, &entry.second, hash);
+    }
+
+    T remove(const K& key) {
+        if (!size())
+            throw std::runtime_error("Empty tree: element not found.");
+
+        std::size_t i = _probe(key, _hasher(key));
+        if (!_slots[i]._key)
+            throw std::runtime_error("Element not found!");
+
+        // The slot points into the node we are about to free.
+        _eraseSlot(i);
+        return _tree.remove(key);
+    }
+
+    T& get(const K& key) {
+        auto slot = _lookup(key);
+        if (slot == nullptr)
+            throw std::runtime_error("Element not found.");
+
+        return *slot->_data;
+    }
+
+    const T& get(const K& key) const {
+        auto slot = _lookup(key);
+        if (slot == nullptr)
+            throw std::runtime_error("Element not found.");
+
+        return *slot->_data;
+    }
+
+    bool contains(const K& key) const {
+        return _lookup(key) != nullptr;
+    }
+
+    int size() const {
+        return _tree.size();
+    }
+
+    int height() const {
+        return _tree.height();
+    }
+
+    Iterator begin() {
+        return _tree.begin();
+    }
+
+    Iterator end() {
+        return _tree.end();
+    }
+
+    Iterator find(const K& key) {
+        // The iterator needs the path from the root, so skip the descent
+        // only when the index tells us the key is not there.
+        if (!contains(key))
+            return end();
+
+        return _tree.find(key);
+    }
+
+    friend std::ostream& operator<<(std::ostream& os,
+                                    const HashedAVLTree& tree) {
+        os << tree._tree;
+        return os;
+    }
+};
+} // namespace vk_data